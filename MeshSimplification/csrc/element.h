@@ -20,6 +20,9 @@ class Vertex {
   private:
   public:
     int idx;
+    int timestamp = 0; // globalTime of the last update of this vertex
+    int part = 0;         // partition of this vertex
+    bool frozen = false;  // on a partition border, can not be contracted
     double x, y, z;
     double Q[16]; // Q is a 4*4 matrix.
     std::vector<Triangle *> triangles;
@@ -75,6 +78,8 @@ class Triangle {
         // v0 -> v1, v1 - > v2, v2 -> v0;
         std::swap(v0, v1); // v1, v0, v2
         std::swap(v0, v2); // v2, v0, v1
+        std::swap(w0, w1);
+        std::swap(w0, w2);
         return;
     }
 
@@ -82,6 +87,8 @@ class Triangle {
         // v0 -> v2, v1 -> v0, v2 -> v1;
         std::swap(v0, v2); // v1, v0, v2
         std::swap(v0, v1); // v2, v0, v1
+        std::swap(w0, w2);
+        std::swap(w0, w1);
         return;
     }
 
@@ -102,11 +109,14 @@ class Triangle {
     Vertex *v0;
     Vertex *v1;
     Vertex *v2;
+    // wedges (attribute ids) of the corners v0, v1, v2, -1 without attributes
+    int w0, w1, w2;
     // parameters (p0x + p1y + p2z + p3 = 0)
     double p[4];
 
-    Triangle(Vertex *v0_, Vertex *v1_, Vertex *v2_)
-        : v0(v0_), v1(v1_), v2(v2_) {
+    Triangle(Vertex *v0_, Vertex *v1_, Vertex *v2_, int w0_ = -1,
+             int w1_ = -1, int w2_ = -1)
+        : v0(v0_), v1(v1_), v2(v2_), w0(w0_), w1(w1_), w2(w2_) {
         regularize();
         initParameters();
     }
@@ -137,6 +147,15 @@ class Triangle {
         return v0->idx == v->idx || v1->idx == v->idx || v2->idx == v->idx;
     }
 
+    inline int &wedgeOf(const Vertex *v) {
+        // Wedge of the corner at v, which must be a vertex of this triangle
+        if (v0->idx == v->idx)
+            return w0;
+        if (v1->idx == v->idx)
+            return w1;
+        return w2;
+    }
+
     void removeItself(const Vertex *removed_vertex) {
         // Remove a triangle from all its vertex
         // removed_vertex: vertex that is removed and causes this triangle to be
@@ -229,4 +248,21 @@ class VertexPair {
     }
 };
 
+// A compact record of a VertexPair in the heap.
+// VertexPair carries a whole Vertex, so the heap only keeps (cost, indices,
+// timestamp) and the VertexPair is rebuilt when the record is popped.
+struct PairRecord {
+    double cost;
+    int v0, v1;    // indices of vertices, v0 < v1
+    int timestamp; // timestamp of the vertex pair when it is added to the heap
+
+    // Same order as VertexPair: used with std::push_heap / std::pop_heap, the
+    // front of the heap is the record with the lowest cost.
+    inline bool operator<(const PairRecord &rec) const {
+        if (cost != rec.cost)
+            return cost > rec.cost;
+        return v0 > rec.v0 || (v0 == rec.v0 && v1 > rec.v1);
+    }
+};
+
 #endif // ELEMENTS_H
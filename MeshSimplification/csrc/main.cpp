@@ -1,34 +1,53 @@
+#include <chrono>
+
 #include "mesh.h"
 
+// Wall time in seconds. clock() sums up the CPU time of all threads.
+double wallTime() {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 int main(int argc, char **argv) {
     std::string input_path;
     std::string output_path;
     double ratio;
+    double heap_limit_mb = 0; // 0 for no limit
+    int partitions = 1;
 
     if (argc < 4) {
-        std::cout << "Usage: ms <input> <output> <ratio>" << std::endl;
+        std::cout << "Usage: ms <input> <output> <ratio> [heap_limit_mb] "
+                     "[partitions]"
+                  << std::endl;
         exit(0);
     }
 
     input_path = argv[1];
     output_path = argv[2];
     ratio = atof(argv[3]);
+    if (argc > 4)
+        heap_limit_mb = atof(argv[4]);
+    if (argc > 5)
+        partitions = atoi(argv[5]);
 
-    time_t st = clock();
+    double st = wallTime();
 
     Mesh mesh;
+    mesh.setHeapMemoryLimit(size_t(heap_limit_mb * (1 << 20)));
+    mesh.setPartitions(partitions);
 
     mesh.load(input_path);
-    time_t ed1 = clock();
+    double ed1 = wallTime();
 
     mesh.calculateQ();
-    time_t ed2 = clock();
+    double ed2 = wallTime();
 
     mesh.selectValidPairs(0.01); // threshold
-    time_t ed3 = clock();
+    double ed3 = wallTime();
 
     mesh.simplify(ratio);
-    time_t ed4 = clock();
+    double ed4 = wallTime();
 
     double error = mesh.evaluate();
 
@@ -36,15 +55,20 @@ int main(int argc, char **argv) {
 
     std::cout << "Evaluated Error: " << error << std::endl;
 
-    std::cout << "Total Running Time: " << double(ed4 - st) / CLOCKS_PER_SEC
-              << " (s)" << std::endl;
-    std::cout << "Load Mesh Time: " << double(ed1 - st) / CLOCKS_PER_SEC
-              << " (s)" << std::endl;
-    std::cout << "Calculate Q Time: " << double(ed2 - ed1) / CLOCKS_PER_SEC
-              << " (s)" << std::endl;
-    std::cout << "Select Valid Pairs Time: "
-              << double(ed3 - ed2) / CLOCKS_PER_SEC << " (s)" << std::endl;
-    std::cout << "Simplify Time: " << double(ed4 - ed3) / CLOCKS_PER_SEC
-              << " (s)" << std::endl;
+    std::cout << "Total Running Time: " << ed4 - st << " (s)" << std::endl;
+    std::cout << "Load Mesh Time: " << ed1 - st << " (s)" << std::endl;
+    std::cout << "Calculate Q Time: " << ed2 - ed1 << " (s)" << std::endl;
+    std::cout << "Select Valid Pairs Time: " << ed3 - ed2 << " (s)"
+              << std::endl;
+    std::cout << "Simplify Time: " << ed4 - ed3 << " (s)" << std::endl;
+    if (partitions > 1) {
+        std::cout << "Parallel Partitions Time: " << mesh.getPartitionTime()
+                  << " (s)" << std::endl;
+        std::cout << "Seam Pass Time: " << mesh.getSeamTime() << " (s)"
+                  << std::endl;
+    }
+    std::cout << "Heap Peak Memory: "
+              << double(mesh.getHeapPeakBytes()) / (1 << 20) << " (MB)"
+              << std::endl;
     return 0;
 }
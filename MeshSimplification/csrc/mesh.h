@@ -5,16 +5,41 @@
 #define MESH_H
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <map>
-#include <queue>
 #include <sstream>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include "element.h"
+#include "quadric.h"
+
+// A binary heap of pairs (lazy deletion) with its own clock. The whole mesh
+// uses one PairHeap; in partitioned mode each partition has its own one so
+// that partitions can be simplified concurrently.
+struct PairHeap {
+    std::vector<PairRecord> records;
+    int triangleCnt = 0; // number of remain triangles in the region
+    int removedCnt = 0;  // number of triangles removed, frozen ones included
+    int globalTime = 0;  // Each state update will tick this time
+    size_t stale = 0;    // number of stale records in the heap
+    size_t peakBytes = 0; // peak allocated bytes of the heap
+    int compactions = 0;
+    int refills = 0;
+    int part = 0; // partition of the pairs in the heap
+    size_t limitBytes = 0; // share of the heap memory limit
+
+    // Pairs with cost >= floor may have been evicted to stay under the
+    // memory limit. They are made again from Vertex::paired when the heap
+    // drains, so no pair below the floor is ever missing.
+    double floor = INFINITY;
+};
 
 // A Trimesh-style Mesh Object, storing vertices,
 class Mesh {
@@ -22,16 +47,301 @@ class Mesh {
     std::vector<Vertex *> vertices;
     std::vector<int> ordered_indices; // used in select pairs
     std::vector<Triangle *> triangles;
-    std::priority_queue<VertexPair> pq;
+    std::vector<PairHeap> heaps; // one per partition
 
-    std::map<std::pair<int, int>, int>
-        lastTimestampOfPair; // Record the last timestamp of the pair. Key is
-                             // (ordered) indices of vertices
+    // Heap memory control. A record is stale when one of its vertices is
+    // removed or updated after it is pushed. Stale records are dropped when
+    // their ratio exceeds maxStaleRatio, or when growing the heaps would
+    // exceed heapMemoryLimit in total (0 for no limit). If the live records
+    // alone fill the limit, the most costly ones are evicted.
+    size_t heapMemoryLimit = 0; // bytes
+    double maxStaleRatio = 0.5;
+    size_t heapPeakBytes = 0; // peak allocated bytes of all heaps
+    int heapCompactions = 0;
+    int heapRefills = 0;
 
-    int triangleCnt = 0; // number of remain triangles
-    int globalTime = 0;  // Each state update will tick this time
+    int partitionCnt = 1; // number of spatial partitions
+    int triangleCnt = 0;  // number of remain triangles
+    double threshold = 0; // distance threshold of the non-edge pairs
+
+    // Wall time of the two phases of the partitioned mode (s)
+    double partitionTime = 0;
+    double seamTime = 0;
+
+    // Attributes (uv and/or normal) are stored per wedge: a vertex has one
+    // wedge per distinct (vt, vn) of its corners, so a uv seam or a sharp
+    // normal splits the attributes but never the position. The streams are
+    // indexed by the wedge id: [u, v, nx, ny, nz] (only the present ones).
+    bool hasUV = false;
+    bool hasNormal = false;
+    int attrDim = 0;                // number of attributes per wedge
+    std::vector<double> attributes; // attrDim doubles per wedge
+    std::vector<double> attrQ;      // generalized quadric per wedge
+    std::vector<double> seamQ;      // 4*4 quadric of the seam planes per vertex
+
+    // Penalty of the planes that keep seam and boundary edges in place
+    double seamWeight = 1000;
+
+    void makeWedges(std::vector<int> &corners, const std::vector<double> &uvs,
+                    const std::vector<double> &normals) {
+        // Give each distinct (v, vt, vn) of the corners a wedge, and build
+        // the attribute streams. The vt of each corner is rewritten to the
+        // wedge id.
+        std::map<std::tuple<int, int, int>, int> wedgeIds;
+        for (int i = 0; i < corners.size(); i += 3) {
+            int vt = corners[i + 1], vn = corners[i + 2];
+            auto key = std::make_tuple(corners[i], vt, vn);
+            auto it = wedgeIds.find(key);
+            if (it != wedgeIds.end()) {
+                corners[i + 1] = it->second;
+                continue;
+            }
+
+            int w = wedgeIds.size();
+            wedgeIds[key] = w;
+            corners[i + 1] = w;
+            attributes.resize(attributes.size() + attrDim, 0);
+            double *attr = &attributes[w * attrDim];
+            if (hasUV) {
+                if (vt >= 0) {
+                    attr[0] = uvs[vt * 2];
+                    attr[1] = uvs[vt * 2 + 1];
+                }
+                attr += 2;
+            }
+            if (hasNormal && vn >= 0) {
+                attr[0] = normals[vn * 3];
+                attr[1] = normals[vn * 3 + 1];
+                attr[2] = normals[vn * 3 + 2];
+            }
+        }
+    }
+
+    static void parseCorner(const std::string &token, int &v, int &vt,
+                            int &vn) {
+        // Parse a face corner "v", "v/vt", "v//vn" or "v/vt/vn".
+        // Missing indices are set to 0.
+        v = vt = vn = 0;
+        int *fields[3] = {&v, &vt, &vn};
+        int field = 0;
+        size_t start = 0;
+        while (field < 3) {
+            size_t end = token.find('/', start);
+            std::string s = token.substr(start, end - start);
+            if (!s.empty())
+                *fields[field] = atoi(s.c_str());
+            if (end == std::string::npos)
+                break;
+            start = end + 1;
+            ++field;
+        }
+    }
+
+    template <int N>
+    void getPoint(const Vertex *v, int w, double *p) const {
+        // Point of wedge w of v in the (3 + N)-dimensional attribute space.
+        p[0] = v->x;
+        p[1] = v->y;
+        p[2] = v->z;
+        for (int i = 0; i < N; ++i)
+            p[3 + i] = attributes[w * N + i];
+    }
+
+    template <int N> void calculateAttributeQ() {
+        typedef AttrQuadric<N> AQ;
+        attrQ.assign(attributes.size() / N * AQ::SIZE, 0);
+        seamQ.assign(vertices.size() * 16, 0);
+
+        for (auto t : triangles) {
+            double p0[AQ::DIM], p1[AQ::DIM], p2[AQ::DIM];
+            getPoint<N>(t->v0, t->w0, p0);
+            getPoint<N>(t->v1, t->w1, p1);
+            getPoint<N>(t->v2, t->w2, p2);
+
+            double faceQ[AQ::SIZE];
+            memset(faceQ, 0, sizeof(faceQ));
+            AQ::addFace(faceQ, p0, p1, p2);
+
+            for (auto w : {t->w0, t->w1, t->w2}) {
+                double *Q = &attrQ[w * AQ::SIZE];
+                for (int i = 0; i < AQ::SIZE; ++i)
+                    Q[i] += faceQ[i];
+            }
+        }
+
+        // Boundary edges have only one face, and seam edges have faces with
+        // different wedges at an end. Like Garland and Heckbert, constrain
+        // them with a plane through the edge and perpendicular to the face,
+        // so that the discontinuity does not move away.
+        struct EdgeUse {
+            int cnt = 0;
+            int wa, wb; // wedges at the ends of the first face
+            bool seam = false;
+        };
+        std::map<std::pair<int, int>, EdgeUse> edges;
+        auto forEdges = [](Triangle *t, auto f) {
+            f(t->v0, t->w0, t->v1, t->w1);
+            f(t->v1, t->w1, t->v2, t->w2);
+            f(t->v2, t->w2, t->v0, t->w0);
+        };
+        for (auto t : triangles) {
+            forEdges(t, [&edges](Vertex *a, int wa, Vertex *b, int wb) {
+                if (a->idx > b->idx) {
+                    std::swap(a, b);
+                    std::swap(wa, wb);
+                }
+                EdgeUse &e = edges[std::make_pair(a->idx, b->idx)];
+                if (e.cnt == 0) {
+                    e.wa = wa;
+                    e.wb = wb;
+                } else if (e.wa != wa || e.wb != wb) {
+                    e.seam = true;
+                }
+                ++e.cnt;
+            });
+        }
+        for (auto t : triangles) {
+            forEdges(t, [this, &edges, t](Vertex *a, int, Vertex *b, int) {
+                const EdgeUse &e = edges[std::minmax(a->idx, b->idx)];
+                if (e.cnt == 1 || e.seam)
+                    addSeamPlane(t, a, b);
+            });
+        }
+    }
+
+    void addSeamPlane(const Triangle *t, const Vertex *a, const Vertex *b) {
+        // m = (b - a) x n
+        double ex = b->x - a->x, ey = b->y - a->y, ez = b->z - a->z;
+        double m[3] = {ey * t->p[2] - ez * t->p[1], ez * t->p[0] - ex * t->p[2],
+                       ex * t->p[1] - ey * t->p[0]};
+        double norm = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+        if (!(norm > 1e-12))
+            return; // degenerated edge or triangle
+        double plane[4] = {m[0] / norm, m[1] / norm, m[2] / norm, 0};
+        plane[3] = -plane[0] * a->x - plane[1] * a->y - plane[2] * a->z;
+
+        // The face plane is added with the same weight, so the penalty is
+        // the distance to the line of the edge. On a curved surface the
+        // perpendicular planes alone meet near the center of curvature and
+        // would pull the seam vertices inside.
+        for (auto v : {a, b}) {
+            double *Q = &seamQ[v->idx * 16];
+            for (int i = 0; i < 4; ++i)
+                for (int j = 0; j < 4; ++j)
+                    Q[i * 4 + j] += seamWeight * (plane[i] * plane[j] +
+                                                  t->p[i] * t->p[j]);
+        }
+    }
+
+    void groupWedges(const Vertex *v0, const Vertex *v1,
+                     std::vector<std::pair<int, int>> &wedges) const {
+        // Wedges around the contracted vertex of (v0, v1), as (wedge, the
+        // wedge it is merged into). A wedge of v1 is merged into the wedge of
+        // v0 across a face of the edge (v0, v1); the other ones are kept, so
+        // that a seam crossing or ending at the edge survives.
+        auto found = [&wedges](int w) {
+            for (auto &e : wedges)
+                if (e.first == w)
+                    return true;
+            return false;
+        };
+        wedges.clear();
+        for (auto t : v0->triangles) {
+            int w = t->wedgeOf(v0);
+            if (!found(w))
+                wedges.emplace_back(w, w);
+        }
+        for (auto t : v1->triangles) {
+            int w = t->wedgeOf(v1);
+            if (t->contains(v0) && !found(w))
+                wedges.emplace_back(w, t->wedgeOf(v0));
+        }
+        for (auto t : v1->triangles) {
+            int w = t->wedgeOf(v1);
+            if (!found(w))
+                wedges.emplace_back(w, w);
+        }
+    }
+
+    template <int N>
+    void solveWedge(const double *Q, const Vertex &p, int w, double *v) const {
+        // Attributes of wedge w at the position p. A singular quadric keeps
+        // the current attributes.
+        v[0] = p.x;
+        v[1] = p.y;
+        v[2] = p.z;
+        for (int i = 0; i < N; ++i)
+            v[3 + i] = attributes[w * N + i];
+        AttrQuadric<N>::optimizeAttributes(Q, v);
+    }
+
+    template <int N>
+    Vertex getContractedPosition(Vertex *v0, Vertex *v1) const {
+        // The position is solved once from the geometric quadrics and the
+        // seam planes; the attributes of each wedge follow it.
+        double contracted_Q[16];
+        const double *S0 = &seamQ[v0->idx * 16], *S1 = &seamQ[v1->idx * 16];
+        for (int i = 0; i < 16; ++i)
+            contracted_Q[i] = v0->Q[i] + v1->Q[i] + S0[i] + S1[i];
+        return getContractedV(contracted_Q, v0, v1);
+    }
+
+    template <int N>
+    VertexPair makeAttributePair(Vertex *v0, Vertex *v1,
+                                 const PairHeap &heap) const {
+        // Error of the pair: the generalized quadrics of the merged wedges,
+        // each at its optimal attributes, plus the seam planes.
+        typedef AttrQuadric<N> AQ;
+        Vertex p = getContractedPosition<N>(v0, v1);
+
+        std::vector<std::pair<int, int>> wedges;
+        groupWedges(v0, v1, wedges);
+        double error = 0;
+        for (auto &e : wedges) {
+            if (e.first != e.second)
+                continue;
+            double Q[AQ::SIZE];
+            memcpy(Q, &attrQ[e.first * AQ::SIZE], sizeof(Q));
+            for (auto &m : wedges) {
+                if (m.second != e.first || m.first == e.first)
+                    continue;
+                const double *Qm = &attrQ[m.first * AQ::SIZE];
+                for (int i = 0; i < AQ::SIZE; ++i)
+                    Q[i] += Qm[i];
+            }
+            double v[AQ::DIM];
+            solveWedge<N>(Q, p, e.first, v);
+            error += AQ::error(Q, v);
+        }
 
-    void makeVertexPair(Vertex *v0, Vertex *v1) {
+        double S[16];
+        for (int i = 0; i < 16; ++i)
+            S[i] = seamQ[v0->idx * 16 + i] + seamQ[v1->idx * 16 + i];
+        error += getQuadricsError(S, p);
+        return VertexPair(v0, v1, p, error, heap.globalTime);
+    }
+
+    VertexPair makePositionPair(Vertex *v0, Vertex *v1,
+                                const PairHeap &heap) const {
+        double contracted_Q[16];
+        for (int i = 0; i < 16; ++i) {
+            contracted_Q[i] = v0->Q[i] + v1->Q[i];
+        }
+        Vertex contracted_v = std::move(getContractedV(contracted_Q, v0, v1));
+        double error = getQuadricsError(contracted_Q, contracted_v);
+        return VertexPair(v0, v1, contracted_v, error, heap.globalTime);
+    }
+
+    template <int N>
+    VertexPair makePair(Vertex *v0, Vertex *v1, const PairHeap &heap) const {
+        // Position-only meshes (N = 0) go through the plain 4*4 quadrics.
+        if (N == 0)
+            return makePositionPair(v0, v1, heap);
+        return makeAttributePair<N>(v0, v1, heap);
+    }
+
+    template <int N>
+    void makeVertexPair(PairHeap &heap, Vertex *v0, Vertex *v1) {
         // Make a VertexPair and add it into the heap.
 
         // std::cout << v0 << " " << v1 << std::endl;
@@ -54,58 +364,177 @@ class Mesh {
         if (v0->idx > v1->idx)
             std::swap(v0, v1);
 
-        auto hash = std::make_pair(v0->idx, v1->idx);
+        VertexPair pair = makePair<N>(v0, v1, heap);
 
-        // Avoid repeated add
-        // Last timestamp equals to current globalTime
-        if (lastTimestampOfPair.count(hash) &&
-            lastTimestampOfPair[hash] == globalTime) {
-            return;
-        } else {
-            lastTimestampOfPair[hash] = globalTime;
+        v0->paired.insert(v1->idx);
+        v1->paired.insert(v0->idx);
+
+        pushRecord(heap, {pair.cost, v0->idx, v1->idx, heap.globalTime});
+    }
+
+    void makeVertexPair(PairHeap &heap, Vertex *v0, Vertex *v1) {
+        // Dispatch to the kernel specialized for attrDim.
+        switch (attrDim) {
+        case 0:
+            return makeVertexPair<0>(heap, v0, v1);
+        case 2:
+            return makeVertexPair<2>(heap, v0, v1);
+        case 3:
+            return makeVertexPair<3>(heap, v0, v1);
+        case 5:
+            return makeVertexPair<5>(heap, v0, v1);
+        default:
+            std::cout << "[MS] Error: unsupported attribute dim " << attrDim
+                      << std::endl;
+            exit(-1);
         }
+    }
 
-        double contracted_Q[16];
-        for (int i = 0; i < 16; ++i) {
-            contracted_Q[i] = v0->Q[i] + v1->Q[i];
+    void pushRecord(PairHeap &heap, const PairRecord &rec) {
+        std::vector<PairRecord> &records = heap.records;
+        if (rec.cost >= heap.floor)
+            return; // made again when the heap drains
+        if (records.size() == records.capacity() && !growRecords(heap)) {
+            evictRecords(heap);
+            if (rec.cost >= heap.floor)
+                return;
+        }
+        records.push_back(rec);
+        std::push_heap(records.begin(), records.end());
+    }
+
+    bool growRecords(PairHeap &heap) {
+        // Make room for one more record. Return false if the heap is at the
+        // memory limit and (nearly) full of live records.
+        std::vector<PairRecord> &records = heap.records;
+        size_t capacity = std::max<size_t>(1, 2 * records.capacity());
+        if (heapMemoryLimit == 0) {
+            reserveRecords(heap, capacity);
+            return true;
         }
-        Vertex contracted_v = std::move(getContractedV(contracted_Q, v0, v1));
-        double error = getQuadricsError(contracted_Q, contracted_v);
-        VertexPair pair(v0, v1, contracted_v, error, globalTime);
 
-        // std::cout << "Add VertexPair: " << v0->idx << " " << v1->idx << " "
-        //           << pair.timestamp << std::endl;
+        // Both buffers are alive while the records are moved, so the new one
+        // only gets what the old one leaves of the share of this heap.
+        size_t limitRecords =
+            std::max<size_t>(64, heap.limitBytes / sizeof(PairRecord));
+        if (records.capacity() + capacity > limitRecords && heap.stale > 0) {
+            // Drop stale records first. At least 1/16 of the buffer must be
+            // free afterwards, or we would compact again after a few pushes.
+            compactHeap(heap);
+            if (records.size() + records.capacity() / 16 <= records.capacity())
+                return true;
+        }
+        capacity = std::min(capacity,
+                            limitRecords - std::min(limitRecords,
+                                                    records.capacity()));
+        if (capacity <= records.size())
+            return false;
+        reserveRecords(heap, capacity);
+        return true;
+    }
 
-        // if (v0->idx == 2096 && v1->idx == 2097) {
-        //     std::cout << v0->x << " " << v0->y << " " << v0->z << std::endl;
-        //     for (int i = 0; i < 16; ++i) {
-        //         std::cout << v0->Q[i] << " ";
-        //     }
-        //     std::cout << "error: " << error << std::endl;
-        // }
+    void evictRecords(PairHeap &heap) {
+        // Keep the cheapest 3/4 of the records and lower the floor to the
+        // cost of the cheapest evicted one.
+        std::vector<PairRecord> &records = heap.records;
+        size_t keep = records.size() * 3 / 4;
+        auto cheaper = [](const PairRecord &a, const PairRecord &b) {
+            return b < a;
+        };
+        std::nth_element(records.begin(), records.begin() + keep,
+                         records.end(), cheaper);
+        heap.floor = records[keep].cost;
+        records.erase(records.begin() + keep, records.end());
+        std::make_heap(records.begin(), records.end());
+    }
 
-        v0->paired.insert(v1->idx);
-        v1->paired.insert(v0->idx);
+    template <int N> void refillHeap(PairHeap &heap) {
+        // All the pairs below the floor are contracted: make the pairs of
+        // the region again from Vertex::paired. Vertices of other partitions
+        // are skipped before anything else of them is read, since their
+        // threads are running.
+        heap.floor = INFINITY;
+        heap.stale = 0;
+        ++heap.refills;
+        for (auto v : vertices) {
+            if (v->part != heap.part || v->frozen || v->isRemoved())
+                continue;
+            for (auto idx : v->paired) {
+                if (idx > v->idx)
+                    makeVertexPair<N>(heap, v, vertices[idx]);
+            }
+        }
+    }
 
-        // std::cout << pair << std::endl;
+    void reserveRecords(PairHeap &heap, size_t capacity) {
+        // Resize the buffer of the heap. The old buffer is alive while the
+        // records are moved, so it is counted in the peak.
+        std::vector<PairRecord> &records = heap.records;
+        size_t oldCapacity = records.capacity();
+        if (capacity < records.size())
+            return;
+        if (capacity > oldCapacity) {
+            records.reserve(capacity);
+        } else {
+            std::vector<PairRecord>(records.begin(), records.end())
+                .swap(records);
+        }
+        heap.peakBytes =
+            std::max(heap.peakBytes, (oldCapacity + records.capacity()) *
+                                         sizeof(PairRecord));
+    }
+
+    inline bool isStale(const PairRecord &rec) const {
+        // Cost of a pair only changes when one of its vertices is updated
+        const Vertex *v0 = vertices[rec.v0];
+        const Vertex *v1 = vertices[rec.v1];
+        return v0->isRemoved() || v1->isRemoved() ||
+               rec.timestamp < std::max(v0->timestamp, v1->timestamp);
+    }
 
-        pq.push(std::move(pair));
+    void compactHeap(PairHeap &heap) {
+        // Drop all stale records and rebuild the heap.
+        std::vector<PairRecord> &records = heap.records;
+        records.erase(std::remove_if(records.begin(), records.end(),
+                                     [this](const PairRecord &rec) {
+                                         return isStale(rec);
+                                     }),
+                      records.end());
+        std::make_heap(records.begin(), records.end());
+        if (records.capacity() > 2 * records.size())
+            reserveRecords(heap, records.size());
+        heap.stale = 0;
+        ++heap.compactions;
     }
 
-    bool contract(VertexPair &pair) {
+    template <int N> bool contract(PairHeap &heap, const PairRecord &rec) {
         // Contract the VertexPair at the top of the heap.
         // Return true/false: whether the triangles are reduced.
 
-        if (pair.v0->isRemoved() || pair.v1->isRemoved()) {
+        if (isStale(rec)) {
             // Lazy deletion in the heap
+            --heap.stale;
             return false;
         }
 
-        auto hash = std::make_pair(pair.v0->idx, pair.v1->idx);
-        if (lastTimestampOfPair[hash] > pair.timestamp) {
-            // Expired pair
-            return false;
-        }
+        // Only the position is solved here; the cost is the one in rec.
+        Vertex *v0 = vertices[rec.v0], *v1 = vertices[rec.v1];
+        VertexPair pair =
+            N == 0 ? makePositionPair(v0, v1, heap)
+                   : VertexPair(v0, v1, getContractedPosition<N>(v0, v1),
+                                rec.cost, heap.globalTime);
+
+        // Wedges of v1 merged into the ones of v0, before the faces of the
+        // edge are removed
+        std::vector<std::pair<int, int>> wedges;
+        if (N > 0)
+            groupWedges(pair.v0, pair.v1, wedges);
+        auto mergedWedge = [&wedges](int w) {
+            for (auto &e : wedges)
+                if (e.first == w)
+                    return e.second;
+            return w;
+        };
 
         if (pair.v0->idx == pair.v1->idx) {
             std::cout << "[MS] Error: contract a pair (v0, v0): v0="
@@ -115,18 +544,24 @@ class Mesh {
 
         // std::cout << pair << std::endl;
 
-        ++globalTime; // Tick it
+        ++heap.globalTime; // Tick it
 
         // Step 1. Remove v1
         for (auto t : pair.v1->triangles) {
             // std::cout << *t << std::endl;
             if (t->contains(pair.v0)) {
-                // Remove faces which contain both v0, v1
-                triangleCnt--;
+                // Remove faces which contain both v0, v1. Only faces counted
+                // in the region (see splitPartitions) are counted down.
+                if (isRegionTriangle(t))
+                    heap.triangleCnt--;
+                heap.removedCnt++;
                 t->removeItself(pair.v1);
             } else {
                 // Replaces v1 with v0
+                int &w = t->wedgeOf(pair.v1);
                 t->replaceVertexWith(pair.v1, pair.v0);
+                if (N > 0)
+                    w = mergedWedge(w);
             }
             // Parameters of triangles are not used after we finish calculating
             // Q, so we don't need to update them.
@@ -134,16 +569,48 @@ class Mesh {
 
         // Step 2. Update v0 to \overline{v}
         pair.v0->update(pair.contracted_v, pair.v1->Q);
+        if (N > 0) {
+            // Accumulate the quadrics of the merged wedges and of the seams,
+            // then move the attributes of every wedge of v0 to the new
+            // position.
+            typedef AttrQuadric<N> AQ;
+            for (auto &e : wedges) {
+                if (e.first == e.second)
+                    continue;
+                double *Q0 = &attrQ[e.second * AQ::SIZE];
+                const double *Q1 = &attrQ[e.first * AQ::SIZE];
+                for (int i = 0; i < AQ::SIZE; ++i)
+                    Q0[i] += Q1[i];
+            }
+            for (int i = 0; i < 16; ++i)
+                seamQ[pair.v0->idx * 16 + i] += seamQ[pair.v1->idx * 16 + i];
+
+            for (auto &e : wedges) {
+                if (e.first != e.second)
+                    continue;
+                double v[AQ::DIM];
+                solveWedge<N>(&attrQ[e.first * AQ::SIZE], *pair.v0, e.first,
+                              v);
+                for (int i = 0; i < N; ++i)
+                    attributes[e.first * N + i] = v[3 + i];
+            }
+        }
+
+        pair.v0->timestamp = heap.globalTime;
+
+        // All other records of v0 and v1 become stale. The popped one is not
+        // in the heap any more. Once pairs are evicted this is an upper
+        // bound, which the next compaction makes exact again.
+        heap.stale += pair.v0->paired.size() - 1 + pair.v1->paired.size() - 1;
 
-        // Step 3. Replace all pairs related to v1 (v2, v1) with (v2, v0) and
-        // re-insert them to heap
+        // Step 3. Replace all pairs related to v1 (v2, v1) with (v2, v0)
         //
         // - Here we use a lazy way:
         //   - We mark v1 as removed (as we already did before), and leave all
         //   pairs with v1 in the heap
-        //   - Each time we pop a VertexPair from the heap, we check whether
-        //   it's a valid pair by checking its two vertices removed or not.
-        //   - So we only need to insert a new pair (x, v0) into the heap.
+        //   - Each time we pop a record from the heap, we check whether
+        //   it's a valid pair by checking its two vertices removed or updated.
+        //   - So we only need to insert the new pairs (x, v0) into the heap.
         for (auto v2_idx : pair.v1->paired) {
             auto v2 = vertices[v2_idx];
 
@@ -154,8 +621,9 @@ class Mesh {
                 continue;
             }
 
-            // Get another vertex
-            makeVertexPair(v2, pair.v0);
+            // Link to v0, the record is made in step 4
+            v2->paired.insert(pair.v0->idx);
+            pair.v0->paired.insert(v2->idx);
         }
 
         // Mark here to since we need v1 idx above
@@ -163,15 +631,240 @@ class Mesh {
 
         // Step 4. Update all v0 pairs
         for (auto v2_idx : pair.v0->paired) {
-            // std::cout << v2_idx << " ";
             // Get another vertex
-            makeVertexPair(vertices[v2_idx], pair.v0);
+            makeVertexPair<N>(heap, vertices[v2_idx], pair.v0);
+        }
+
+        if (heap.records.size() > 1024 &&
+            heap.stale > maxStaleRatio * heap.records.size()) {
+            compactHeap(heap);
         }
-        // std::cout << std::endl;
 
         return true;
     }
 
+    static bool isRegionTriangle(const Triangle *t) {
+        // A triangle is removed by contracting two of its vertices, so one
+        // with at most one frozen vertex belongs to the region of the other
+        // two. Frozen flags do not change until the seam pass, which has a
+        // single region.
+        return t->v0->frozen + t->v1->frozen + t->v2->frozen <= 1;
+    }
+
+    void splitPartitions() {
+        // Split vertices into partitionCnt slabs along y (ordered_indices is
+        // sorted by y). Vertices of the triangles across slabs are frozen.
+        // Every slab has at least one vertex
+        partitionCnt = std::max<int>(
+            1, std::min<size_t>(partitionCnt, vertices.size()));
+        heaps.assign(partitionCnt, PairHeap());
+        for (int i = 0; i < partitionCnt; ++i) {
+            heaps[i].part = i;
+            heaps[i].limitBytes = heapMemoryLimit / partitionCnt;
+        }
+        for (int i = 0; i < vertices.size(); ++i) {
+            vertices[ordered_indices[i]]->part =
+                (long long)i * partitionCnt / vertices.size();
+        }
+        for (auto t : triangles) {
+            int part = t->v0->part;
+            if (t->v1->part != part || t->v2->part != part)
+                t->v0->frozen = t->v1->frozen = t->v2->frozen = true;
+        }
+        // Only triangles the partition can remove are counted, so that it
+        // does not over-simplify its interior to make up for the border
+        // triangles.
+        for (auto t : triangles) {
+            // Its vertices are in the same partition, or all of them would
+            // be frozen
+            if (isRegionTriangle(t))
+                heaps[t->v0->part].triangleCnt++;
+        }
+    }
+
+    void mergeHeaps() {
+        // Merge the heaps of the partitions into one for the seam pass. The
+        // live records are kept. The buffer of a partition is released as
+        // soon as it is merged, and until then it is taken from the limit
+        // of the merged heap.
+        collectHeapStats();
+        std::vector<PairHeap> parts;
+        parts.swap(heaps);
+        heaps.assign(1, PairHeap());
+        PairHeap &heap = heaps[0];
+
+        size_t partBytes = 0;
+        for (auto &part : parts) {
+            // The clocks are per partition, and a record is only compared
+            // with the vertices of its own partition
+            heap.globalTime = std::max(heap.globalTime, part.globalTime);
+            heap.floor = std::min(heap.floor, part.floor);
+            partBytes += part.records.capacity() * sizeof(PairRecord);
+        }
+        for (auto &part : parts) {
+            heap.limitBytes = heapMemoryLimit - std::min(heapMemoryLimit,
+                                                         partBytes);
+            for (auto &rec : part.records) {
+                if (!isStale(rec))
+                    pushRecord(heap, rec);
+            }
+            heap.peakBytes = std::max(
+                heap.peakBytes,
+                heap.records.capacity() * sizeof(PairRecord) + partBytes);
+            partBytes -= part.records.capacity() * sizeof(PairRecord);
+            std::vector<PairRecord>().swap(part.records);
+        }
+        heap.limitBytes = heapMemoryLimit;
+    }
+
+    void addBorderPairs() {
+        // Add the pairs the partitions could not have: edges of the frozen
+        // vertices, and pairs closer than threshold with a frozen vertex or
+        // across partitions. Both vertices of such a threshold pair are in
+        // the band of vertices within threshold (in y) of a frozen vertex
+        // or of another partition, so only the band is sorted and swept.
+        std::vector<double> frozenY;
+        std::vector<double> low(partitionCnt, INFINITY),
+            high(partitionCnt, -INFINITY);
+        for (auto v : vertices) {
+            if (v->isRemoved())
+                continue;
+            if (v->frozen)
+                frozenY.push_back(v->y);
+            low[v->part] = std::min(low[v->part], v->y);
+            high[v->part] = std::max(high[v->part], v->y);
+        }
+        std::sort(frozenY.begin(), frozenY.end());
+
+        std::vector<Vertex *> frozen, band;
+        for (auto v : vertices) {
+            if (v->isRemoved())
+                continue;
+            bool inBand = v->frozen;
+            auto it = std::lower_bound(frozenY.begin(), frozenY.end(),
+                                       v->y - threshold);
+            inBand |= it != frozenY.end() && *it < v->y + threshold;
+            for (int i = 0; i < partitionCnt && !inBand; ++i) {
+                inBand = i != v->part && v->y > low[i] - threshold &&
+                         v->y < high[i] + threshold;
+            }
+            if (v->frozen)
+                frozen.push_back(v);
+            if (inBand)
+                band.push_back(v);
+        }
+
+        // A single region from now on
+        for (auto v : vertices) {
+            v->part = 0;
+            v->frozen = false;
+        }
+
+        auto addPair = [this](Vertex *v0, Vertex *v1) {
+            if (!v0->paired.count(v1->idx))
+                makeVertexPair(heaps[0], v0, v1);
+        };
+        for (auto v : frozen) {
+            for (auto t : v->triangles) {
+                addPair(t->v0, t->v1);
+                addPair(t->v0, t->v2);
+                addPair(t->v1, t->v2);
+            }
+        }
+
+        std::sort(band.begin(), band.end(),
+                  [](const Vertex *v0, const Vertex *v1) {
+                      return v0->y < v1->y;
+                  });
+        for (int i = 0; i < band.size(); ++i) {
+            for (int j = i + 1; j < band.size(); ++j) {
+                if (band[j]->y - band[i]->y > threshold)
+                    break;
+                if (getDistance(band[i], band[j]) < threshold)
+                    addPair(band[i], band[j]);
+            }
+        }
+    }
+
+    void addValidPairs() {
+        // Add edges and pairs closer than threshold into the heaps.
+        // ordered_indices must be sorted by y.
+
+        // Avoid repeated add. Pairs across partitions or with frozen vertices
+        // are left to the final pass.
+        auto addPair = [this](Vertex *v0, Vertex *v1) {
+            if (v0->frozen || v1->frozen || v0->part != v1->part)
+                return;
+            if (!v0->paired.count(v1->idx))
+                makeVertexPair(heaps[v0->part], v0, v1);
+        };
+
+        // Add all edge contractions
+        for (auto &t : triangles) {
+            if (t->isRemoved())
+                continue;
+            addPair(t->v0, t->v1);
+            addPair(t->v0, t->v2);
+            addPair(t->v1, t->v2);
+        }
+
+        for (int i = 0; i < ordered_indices.size(); ++i) {
+            int idx0 = ordered_indices[i];
+            for (int j = i + 1; j < ordered_indices.size(); ++j) {
+                int idx1 = ordered_indices[j];
+                if (getDistance(vertices[idx0], vertices[idx1]) < threshold) {
+                    addPair(vertices[idx0], vertices[idx1]);
+                }
+
+                if (vertices[idx1]->y - vertices[idx0]->y > threshold) {
+                    break;
+                }
+            }
+        }
+    }
+
+    void collectHeapStats() {
+        // Heaps of partitions live at the same time
+        size_t bytes = 0;
+        for (auto &heap : heaps) {
+            bytes += heap.peakBytes;
+            heapCompactions += heap.compactions;
+            heapRefills += heap.refills;
+            heap.compactions = heap.refills = 0;
+        }
+        heapPeakBytes = std::max(heapPeakBytes, bytes);
+    }
+
+    template <int N> void simplifyHeap(PairHeap &heap, int target) {
+        // Contract pairs until the region has target triangles or no pairs.
+        std::vector<PairRecord> &records = heap.records;
+        while (heap.triangleCnt > target) {
+            if (records.empty() && heap.floor != INFINITY)
+                refillHeap<N>(heap);
+            if (records.empty())
+                break;
+            std::pop_heap(records.begin(), records.end());
+            PairRecord rec = records.back();
+            records.pop_back();
+            contract<N>(heap, rec);
+        }
+    }
+
+    void simplifyHeap(PairHeap &heap, int target) {
+        // Nothing is printed per contraction, so the log costs the same with
+        // and without partitions.
+        switch (attrDim) {
+        case 0:
+            return simplifyHeap<0>(heap, target);
+        case 2:
+            return simplifyHeap<2>(heap, target);
+        case 3:
+            return simplifyHeap<3>(heap, target);
+        case 5:
+            return simplifyHeap<5>(heap, target);
+        }
+    }
+
   public:
     ~Mesh() {
         for (auto v : vertices) {
@@ -182,6 +875,16 @@ class Mesh {
         }
     }
 
+    void setHeapMemoryLimit(size_t bytes) { heapMemoryLimit = bytes; }
+
+    void setPartitions(int k) { partitionCnt = std::max(k, 1); }
+
+    size_t getHeapPeakBytes() const { return heapPeakBytes; }
+
+    double getPartitionTime() const { return partitionTime; }
+
+    double getSeamTime() const { return seamTime; }
+
     void load(std::string path) {
         std::cout << "[MS] Load obj from " + path + " ..." << std::endl;
 
@@ -191,6 +894,12 @@ class Mesh {
             exit(-1);
         }
 
+        // Raw attribute records and face corners (v, vt, vn). Triangles are
+        // made after the whole file is read, since the wedges need the
+        // attribute records.
+        std::vector<double> uvs, normals;
+        std::vector<int> corners;
+
         std::string line;
         while (getline(file, line)) {
             std::istringstream iss(line);
@@ -204,26 +913,60 @@ class Mesh {
                 vertices.push_back(v);
                 ordered_indices.push_back(v->idx);
                 // std::cout << "Vertex " << v->idx << " " << v << std::endl;
+            } else if (prefix == "vt") {
+                double u, v;
+                iss >> u >> v;
+                uvs.push_back(u);
+                uvs.push_back(v);
+            } else if (prefix == "vn") {
+                double nx, ny, nz;
+                iss >> nx >> ny >> nz;
+                normals.push_back(nx);
+                normals.push_back(ny);
+                normals.push_back(nz);
             } else if (prefix == "f") {
-                int v0, v1, v2;
-                iss >> v0 >> v1 >> v2;
-                // Note: shift by 1!!!
-                Triangle *t = new Triangle(vertices[v0 - 1], vertices[v1 - 1],
-                                           vertices[v2 - 1]);
-                triangles.push_back(t);
-
-                // Note: here we should use address in the global memory pool!
-                t->v0->triangles.push_back(t);
-                t->v1->triangles.push_back(t);
-                t->v2->triangles.push_back(t);
+                for (int i = 0; i < 3; ++i) {
+                    std::string token;
+                    int v, vt, vn;
+                    iss >> token;
+                    parseCorner(token, v, vt, vn);
+                    // Note: shift by 1!!!
+                    corners.push_back(v - 1);
+                    corners.push_back(vt - 1);
+                    corners.push_back(vn - 1);
+                    hasUV |= vt > 0;
+                    hasNormal |= vn > 0;
+                }
             }
         }
+        file.close();
+
+        attrDim = (hasUV ? 2 : 0) + (hasNormal ? 3 : 0);
+        if (attrDim > 0)
+            makeWedges(corners, uvs, normals);
+
+        for (int i = 0; i < corners.size(); i += 9) {
+            // Without attributes the wedges are all -1
+            Triangle *t = new Triangle(
+                vertices[corners[i]], vertices[corners[i + 3]],
+                vertices[corners[i + 6]], corners[i + 1], corners[i + 4],
+                corners[i + 7]);
+            triangles.push_back(t);
+
+            // Note: here we should use address in the global memory pool!
+            t->v0->triangles.push_back(t);
+            t->v1->triangles.push_back(t);
+            t->v2->triangles.push_back(t);
+        }
         triangleCnt = triangles.size();
 
-        file.close();
         std::cout << "[MS] Load finished. "
                   << "Vertices: " << vertices.size() << " "
-                  << "Triangles: " << triangles.size() << std::endl;
+                  << "Triangles: " << triangles.size() << " "
+                  << "Attributes: " << attrDim << " "
+                  << "Wedges: "
+                  << (attrDim > 0 ? attributes.size() / attrDim : 0)
+                  << std::endl;
     }
 
     void store(std::string path) {
@@ -239,10 +982,62 @@ class Mesh {
             }
         }
 
+        if (attrDim == 0) {
+            for (auto &t : triangles) {
+                if (!t->isRemoved())
+                    os << *t << std::endl;
+            }
+            return;
+        }
+
+        // Number the wedges of the remain faces; vt and vn share it
+        std::vector<int> wedgeIdx(attributes.size() / attrDim, 0);
+        std::vector<int> keptWedges;
+        for (auto &t : triangles) {
+            if (t->isRemoved())
+                continue;
+            for (auto w : {t->w0, t->w1, t->w2}) {
+                if (wedgeIdx[w] == 0) {
+                    keptWedges.push_back(w);
+                    wedgeIdx[w] = keptWedges.size();
+                }
+            }
+        }
+
+        if (hasUV) {
+            for (auto w : keptWedges) {
+                const double *attr = &attributes[w * attrDim];
+                os << "vt " << attr[0] << " " << attr[1] << std::endl;
+            }
+        }
+        if (hasNormal) {
+            for (auto w : keptWedges) {
+                const double *attr =
+                    &attributes[w * attrDim + (hasUV ? 2 : 0)];
+                // Interpolated normals are no longer unit vectors
+                double norm = sqrt(attr[0] * attr[0] + attr[1] * attr[1] +
+                                   attr[2] * attr[2]);
+                if (norm <= 1e-12)
+                    norm = 1;
+                os << "vn " << attr[0] / norm << " " << attr[1] / norm << " "
+                   << attr[2] / norm << std::endl;
+            }
+        }
+
         for (auto &t : triangles) {
-            if (!t->isRemoved()) {
-                os << *t << std::endl;
+            if (t->isRemoved())
+                continue;
+            os << "f";
+            for (auto c : {std::make_pair(t->v0, t->w0),
+                           std::make_pair(t->v1, t->w1),
+                           std::make_pair(t->v2, t->w2)}) {
+                os << " " << c.first->idx;
+                if (hasUV)
+                    os << "/" << wedgeIdx[c.second];
+                if (hasNormal)
+                    os << (hasUV ? "/" : "//") << wedgeIdx[c.second];
             }
+            os << std::endl;
         }
     }
 
@@ -252,40 +1047,39 @@ class Mesh {
         for (auto &v : vertices) {
             v->calculateQ();
         }
+
+        // Generalized quadrics for the attributes
+        switch (attrDim) {
+        case 2:
+            calculateAttributeQ<2>();
+            break;
+        case 3:
+            calculateAttributeQ<3>();
+            break;
+        case 5:
+            calculateAttributeQ<5>();
+            break;
+        }
     }
 
-    void selectValidPairs(double threshold) {
+    void selectValidPairs(double threshold_) {
+        threshold = threshold_;
         std::cout << "[MS] Selecting valid pairs with threshold = " << threshold
                   << std::endl;
 
-        // Add all edge contractions
-        for (auto &t : triangles) {
-            makeVertexPair(t->v0, t->v1);
-            makeVertexPair(t->v0, t->v2);
-            makeVertexPair(t->v1, t->v2);
-        }
-
         // Sort indices
         auto cmp = [this](int idx0, int idx1) -> bool {
             return vertices[idx0]->y < vertices[idx1]->y;
         };
         std::sort(ordered_indices.begin(), ordered_indices.end(), cmp);
 
-        for (int i = 0; i < vertices.size(); ++i) {
-            int idx0 = ordered_indices[i];
-            for (int j = i + 1; j < vertices.size(); ++j) {
-                int idx1 = ordered_indices[j];
-                if (getDistance(vertices[idx0], vertices[idx1]) < threshold) {
-                    makeVertexPair(vertices[idx0], vertices[idx1]);
-                }
+        splitPartitions();
+        addValidPairs();
 
-                if (vertices[idx1]->y - vertices[idx0]->y > threshold) {
-                    break;
-                }
-            }
-        }
-
-        std::cout << "[MS] Selection finished. Total pairs: " << pq.size()
+        size_t pairCnt = 0;
+        for (auto &heap : heaps)
+            pairCnt += heap.records.size();
+        std::cout << "[MS] Selection finished. Total pairs: " << pairCnt
                   << std::endl;
     }
 
@@ -295,17 +1089,57 @@ class Mesh {
         // Number of triangles the simplified mesh should have
         const int origTriangleCnt = triangleCnt,
                   simplifiedTriangleCnt = triangleCnt * ratio;
-        while (triangleCnt > simplifiedTriangleCnt) {
-            bool flag = false;
-            while (!flag) {
-                VertexPair pair = std::move(pq.top());
-                pq.pop();
-                flag = contract(pair);
+
+        if (heaps.size() > 1) {
+            // Step 1. Simplify the partitions concurrently, each one to the
+            // ratio of its own triangles. They share no vertices or
+            // triangles since the vertices on the borders are frozen. A pool
+            // of at most one worker per core takes the partitions in turn.
+            auto st = std::chrono::steady_clock::now();
+            int coreCnt = std::max(1u, std::thread::hardware_concurrency());
+            int workerCnt = std::min<int>(heaps.size(), coreCnt);
+            std::atomic<int> nextPart(0);
+            auto worker = [this, &nextPart, ratio]() {
+                for (int i = nextPart++; i < heaps.size(); i = nextPart++)
+                    simplifyHeap(heaps[i], heaps[i].triangleCnt * ratio);
             };
+            std::vector<std::thread> threads;
+            for (int i = 0; i < workerCnt; ++i)
+                threads.emplace_back(worker);
+            for (auto &thread : threads)
+                thread.join();
 
-            std::cout << "[MS] Current triangles: " << triangleCnt << "/"
-                      << origTriangleCnt << std::endl;
+            for (auto &heap : heaps)
+                triangleCnt -= heap.removedCnt;
+            partitionTime = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - st)
+                                .count();
+            std::cout << "[MS] Partitions finished. Current triangles: "
+                      << triangleCnt << "/" << origTriangleCnt << std::endl;
+
+            // Step 2. Clean up the seams with a serial pass over the whole
+            // mesh, keeping the pairs of the partitions.
+            st = std::chrono::steady_clock::now();
+            mergeHeaps();
+            addBorderPairs();
+            heaps[0].triangleCnt = triangleCnt;
+            simplifyHeap(heaps[0], simplifiedTriangleCnt);
+            seamTime = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - st)
+                           .count();
+        } else {
+            heaps[0].triangleCnt = triangleCnt;
+            simplifyHeap(heaps[0], simplifiedTriangleCnt);
         }
+        triangleCnt = heaps[0].triangleCnt;
+        collectHeapStats();
+
+        std::cout << "[MS] Simplify finished. Current triangles: "
+                  << triangleCnt << "/" << origTriangleCnt << std::endl;
+        std::cout << "[MS] Heap peak memory: "
+                  << double(heapPeakBytes) / (1 << 20) << " MB, "
+                  << "compactions: " << heapCompactions << ", "
+                  << "refills: " << heapRefills << std::endl;
     }
 
     double evaluate() {
@@ -0,0 +1,140 @@
+// File: quadric.h
+// Author: SiriusNEO
+
+#ifndef QUADRIC_H
+#define QUADRIC_H
+
+#include <cmath>
+
+// Generalized quadrics over (x, y, z, a_1, ..., a_N), following "Simplifying
+// Surfaces with Color and Texture using Quadric Error Metrics", Garland and
+// Heckbert 98.
+//
+// A quadric is stored as a (DIM+1)*(DIM+1) matrix in the same layout as the
+// 4*4 Q in Vertex:
+// [A,   b]
+// [b^T, c]
+// so the error of a point v is [v, 1]^T Q [v, 1].
+//
+// N is a compile-time constant so that every loop below has a fixed trip
+// count and each attribute count gets its own specialized kernel. Position-only
+// meshes never instantiate these and keep using the 4*4 path in element.cpp.
+template <int N> struct AttrQuadric {
+    static const int DIM = 3 + N; // dimension of a point
+    static const int SIZE = (DIM + 1) * (DIM + 1); // number of entries in Q
+
+    // Add the quadric of triangle (p, q, r) to Q.
+    static void addFace(double *Q, const double *p, const double *q,
+                        const double *r) {
+        // e1 = (q - p) / |q - p|
+        double e1[DIM], e2[DIM];
+        double norm = 0;
+        for (int i = 0; i < DIM; ++i) {
+            e1[i] = q[i] - p[i];
+            norm += e1[i] * e1[i];
+        }
+        norm = sqrt(norm);
+        if (norm <= 1e-12)
+            return; // degenerated triangle
+        for (int i = 0; i < DIM; ++i)
+            e1[i] /= norm;
+
+        // e2 = (r - p - (e1 . (r - p)) e1) / |...|
+        double proj = 0;
+        for (int i = 0; i < DIM; ++i)
+            proj += e1[i] * (r[i] - p[i]);
+        norm = 0;
+        for (int i = 0; i < DIM; ++i) {
+            e2[i] = r[i] - p[i] - proj * e1[i];
+            norm += e2[i] * e2[i];
+        }
+        norm = sqrt(norm);
+        if (norm <= 1e-12)
+            return;
+        for (int i = 0; i < DIM; ++i)
+            e2[i] /= norm;
+
+        double pe1 = 0, pe2 = 0, pp = 0;
+        for (int i = 0; i < DIM; ++i) {
+            pe1 += p[i] * e1[i];
+            pe2 += p[i] * e2[i];
+            pp += p[i] * p[i];
+        }
+
+        // A = I - e1 e1^T - e2 e2^T
+        for (int i = 0; i < DIM; ++i) {
+            for (int j = 0; j < DIM; ++j) {
+                Q[i * (DIM + 1) + j] +=
+                    (i == j ? 1.0 : 0.0) - e1[i] * e1[j] - e2[i] * e2[j];
+            }
+        }
+
+        // b = (p . e1) e1 + (p . e2) e2 - p
+        for (int i = 0; i < DIM; ++i) {
+            double b = pe1 * e1[i] + pe2 * e2[i] - p[i];
+            Q[i * (DIM + 1) + DIM] += b;
+            Q[DIM * (DIM + 1) + i] += b;
+        }
+
+        // c = p . p - (p . e1)^2 - (p . e2)^2
+        Q[DIM * (DIM + 1) + DIM] += pp - pe1 * pe1 - pe2 * pe2;
+    }
+
+    // Solve the attributes of v with its position v[0..2] fixed: minimize
+    // the error over a = v[3..], i.e. A_aa a = -(b_a + A_ap p). Return false
+    // if A_aa is singular, leaving v unchanged.
+    // A_aa is symmetric positive semi-definite, so a Cholesky decomposition
+    // A_aa = L L^T is used (about half the work of Gaussian elimination).
+    static bool optimizeAttributes(const double *Q, double *v) {
+        static const double eps = 1e-12;
+        double L[N][N];
+        for (int j = 0; j < N; ++j) {
+            double d = Q[(3 + j) * (DIM + 1) + 3 + j];
+            for (int k = 0; k < j; ++k)
+                d -= L[j][k] * L[j][k];
+            if (d <= eps)
+                return false;
+            L[j][j] = sqrt(d);
+            for (int i = j + 1; i < N; ++i) {
+                double s = Q[(3 + i) * (DIM + 1) + 3 + j];
+                for (int k = 0; k < j; ++k)
+                    s -= L[i][k] * L[j][k];
+                L[i][j] = s / L[j][j];
+            }
+        }
+
+        // L y = -(b_a + A_ap p)
+        double y[N];
+        for (int i = 0; i < N; ++i) {
+            const double *row = &Q[(3 + i) * (DIM + 1)];
+            double s =
+                -row[DIM] - row[0] * v[0] - row[1] * v[1] - row[2] * v[2];
+            for (int k = 0; k < i; ++k)
+                s -= L[i][k] * y[k];
+            y[i] = s / L[i][i];
+        }
+
+        // L^T a = y
+        for (int i = N - 1; i >= 0; --i) {
+            double s = y[i];
+            for (int k = i + 1; k < N; ++k)
+                s -= L[k][i] * v[3 + k];
+            v[3 + i] = s / L[i][i];
+        }
+        return true;
+    }
+
+    // [v, 1]^T Q [v, 1]
+    static double error(const double *Q, const double *v) {
+        double error = 0;
+        for (int i = 0; i <= DIM; ++i) {
+            double reduceSum = Q[i * (DIM + 1) + DIM];
+            for (int j = 0; j < DIM; ++j)
+                reduceSum += v[j] * Q[i * (DIM + 1) + j];
+            error += (i == DIM ? 1.0 : v[i]) * reduceSum;
+        }
+        return error;
+    }
+};
+
+#endif // QUADRIC_H
@@ -0,0 +1,99 @@
+import math
+import random
+import re
+import subprocess
+import sys
+
+
+# Benchmark the simplify time of the partitioned mode versus K.
+# Run it in the root directory after `bash build.sh`.
+def run(mesh_path, ratio, k):
+    out = subprocess.run(["./ms", mesh_path, "/tmp/bench_partitions.obj",
+                          str(ratio), "0", str(k)],
+                         capture_output=True, text=True, check=True).stdout
+
+    def get(name):
+        match = re.search(name + r": ([\d.e+-]+)", out)
+        return float(match.group(1)) if match else 0.0
+
+    return (get("Simplify Time"), get("Parallel Partitions Time"),
+            get("Seam Pass Time"), get("Evaluated Error"))
+
+
+def generate(faces, path):
+    # A bumpy sphere with about `faces` triangles, for Dragon/Buddha-sized
+    # runs when the real meshes are not available.
+    n = max(4, int(math.sqrt(faces / 4)))
+    rows, cols = n, 2 * n
+    random.seed(0)
+    bumps = [(random.uniform(0, math.pi), random.uniform(0, 2 * math.pi),
+              random.uniform(0.02, 0.08)) for _ in range(8)]
+    with open(path, "w") as f:
+        f.write("v 0 0 1\n")
+        for i in range(1, rows):
+            theta = math.pi * i / rows
+            for j in range(cols):
+                phi = 2 * math.pi * j / cols
+                r = 1 + sum(h * math.cos(4 * (theta - t)) * math.cos(3 * (phi - p))
+                            for t, p, h in bumps)
+                f.write("v {:.6f} {:.6f} {:.6f}\n".format(
+                    r * math.sin(theta) * math.cos(phi),
+                    r * math.sin(theta) * math.sin(phi), r * math.cos(theta)))
+        f.write("v 0 0 -1\n")
+        last = 2 + (rows - 1) * cols
+
+        def idx(i, j):
+            return 2 + (i - 1) * cols + j % cols
+
+        for j in range(cols):
+            f.write("f 1 {} {}\n".format(idx(1, j), idx(1, j + 1)))
+        for i in range(1, rows - 1):
+            for j in range(cols):
+                a, b = idx(i, j), idx(i, j + 1)
+                c, d = idx(i + 1, j), idx(i + 1, j + 1)
+                f.write("f {} {} {}\n".format(a, c, d))
+                f.write("f {} {} {}\n".format(a, d, b))
+        for j in range(cols):
+            f.write("f {} {} {}\n".format(last, idx(rows - 1, j + 1),
+                                          idx(rows - 1, j)))
+
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+
+    if len(args) < 1:
+        print("Usage: python3 bench_partitions.py <mesh_path> ... "
+              "[--generate faces] [--ratio r] [--k 1,2,4,8]")
+        sys.exit(1)
+
+    ratio = 0.1
+    ks = [1, 2, 4, 8]
+    paths = []
+    i = 0
+    while i < len(args):
+        if args[i] == "--ratio":
+            ratio = float(args[i + 1])
+            i += 2
+        elif args[i] == "--k":
+            ks = [int(k) for k in args[i + 1].split(",")]
+            i += 2
+        elif args[i] == "--generate":
+            path = "/tmp/bench_sphere_{}.obj".format(args[i + 1])
+            generate(int(args[i + 1]), path)
+            paths.append(path)
+            i += 2
+        else:
+            paths.append(args[i])
+            i += 1
+
+    print("| Object | K | Simplify Time (s) | Parallel Phase (s) | Seam Pass (s) | Speedup | Avg. Error |")
+    print("| ------ | - | ----------------- | ------------------ | ------------- | ------- | ---------- |")
+    for path in paths:
+        base_time = None
+        for k in ks:
+            simplify_time, parallel_time, seam_time, error = run(path, ratio, k)
+            if base_time is None:
+                base_time = simplify_time
+            print("| {} | {} | {:.2f} | {:.2f} | {:.2f} | {:.2f} | {:.3g} |".format(
+                path.split("/")[-1].split(".")[0], k, simplify_time,
+                parallel_time, seam_time, base_time / simplify_time, error))
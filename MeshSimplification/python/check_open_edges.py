@@ -0,0 +1,131 @@
+import math
+import subprocess
+import sys
+
+
+# Check that uv seams and sharp normals do not tear the mesh: a closed mesh
+# is given a uv wrap seam, or one normal per face, and simplified. After
+# welding the vertices by position the output must have no more open edges
+# than the position-only output, and about the same area.
+# Run it in the root directory after `bash build.sh`.
+def load(path):
+    positions, faces = [], []
+    for line in open(path):
+        tokens = line.split()
+        if not tokens:
+            continue
+        if tokens[0] == "v":
+            positions.append(tuple(float(x) for x in tokens[1:4]))
+        elif tokens[0] == "f":
+            faces.append([int(token.split("/")[0]) - 1
+                          for token in tokens[1:4]])
+    return positions, faces
+
+
+def open_edges(positions, faces):
+    # Weld by position, then count the edges with one face
+    weld = {}
+    ids = [weld.setdefault(p, len(weld)) for p in positions]
+    count = {}
+    for face in faces:
+        for i in range(3):
+            a, b = ids[face[i]], ids[face[(i + 1) % 3]]
+            key = (min(a, b), max(a, b))
+            count[key] = count.get(key, 0) + 1
+    return sum(1 for c in count.values() if c == 1)
+
+
+def area(positions, faces):
+    total = 0.0
+    for a, b, c in faces:
+        p, q, r = positions[a], positions[b], positions[c]
+        e1 = [q[i] - p[i] for i in range(3)]
+        e2 = [r[i] - p[i] for i in range(3)]
+        n = [e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+             e1[0] * e2[1] - e1[1] * e2[0]]
+        total += math.sqrt(sum(x * x for x in n)) / 2
+    return total
+
+
+def write_seamed(positions, faces, path):
+    # Spherical uv around the center. Faces across the wrap get u + 1 at
+    # their low corners, so the vertices there have two uvs.
+    center = [sum(p[i] for p in positions) / len(positions) for i in range(3)]
+    uvs = []
+    with open(path, "w") as f:
+        for p in positions:
+            f.write("v {} {} {}\n".format(*p))
+        for p in positions:
+            d = [p[i] - center[i] for i in range(3)]
+            r = math.sqrt(sum(x * x for x in d)) or 1
+            uvs.append((math.atan2(d[1], d[0]) / (2 * math.pi) + 0.5,
+                        math.acos(max(-1, min(1, d[2] / r))) / math.pi))
+        vts = {}
+        lines = []
+        for face in faces:
+            us = [uvs[v][0] for v in face]
+            wrap = max(us) - min(us) > 0.5
+            corners = []
+            for v in face:
+                uv = uvs[v]
+                if wrap and uv[0] < 0.5:
+                    uv = (uv[0] + 1, uv[1])
+                vt = vts.setdefault(uv, len(vts) + 1)
+                corners.append("{}/{}".format(v + 1, vt))
+            lines.append("f " + " ".join(corners) + "\n")
+        for uv in sorted(vts, key=vts.get):
+            f.write("vt {} {}\n".format(*uv))
+        f.writelines(lines)
+
+
+def write_flat(positions, faces, path):
+    # One normal per face, so every edge is a normal discontinuity
+    with open(path, "w") as f:
+        for p in positions:
+            f.write("v {} {} {}\n".format(*p))
+        for a, b, c in faces:
+            p, q, r = positions[a], positions[b], positions[c]
+            e1 = [q[i] - p[i] for i in range(3)]
+            e2 = [r[i] - p[i] for i in range(3)]
+            n = [e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                 e1[0] * e2[1] - e1[1] * e2[0]]
+            norm = math.sqrt(sum(x * x for x in n)) or 1
+            f.write("vn {} {} {}\n".format(*[x / norm for x in n]))
+        for i, face in enumerate(faces):
+            f.write("f " + " ".join("{}//{}".format(v + 1, i + 1)
+                                    for v in face) + "\n")
+
+
+def simplify(path, ratio):
+    output_path = "/tmp/check_open_edges_out.obj"
+    subprocess.run(["./ms", path, output_path, str(ratio)],
+                   stdout=subprocess.DEVNULL, check=True)
+    return load(output_path)
+
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    paths = args if args else ["obj/Input/Sphere.obj", "obj/Input/Horse.obj"]
+    ratio = 0.1
+
+    failed = False
+    for path in paths:
+        positions, faces = load(path)
+        name = path.split("/")[-1].split(".")[0]
+        base = simplify(path, ratio)
+        base_open, base_area = open_edges(*base), area(*base)
+
+        for kind, write in (("seamed", write_seamed), ("flat", write_flat)):
+            variant_path = "/tmp/check_open_edges_{}.obj".format(kind)
+            write(positions, faces, variant_path)
+            out = simplify(variant_path, ratio)
+            out_open, out_area = open_edges(*out), area(*out)
+            ok = out_open <= base_open and \
+                abs(out_area - base_area) <= 0.05 * base_area
+            failed |= not ok
+            print("{}: {} {}: open edges {} (position-only {}), "
+                  "area {:.4g} (position-only {:.4g})".format(
+                      "OK" if ok else "FAILED", name, kind, out_open,
+                      base_open, out_area, base_area))
+
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,44 @@
+import subprocess
+import sys
+
+
+# Check that a mesh with uv seams is written back unchanged at ratio 1.0:
+# every face corner keeps its position and its uv.
+# Run it in the root directory after `bash build.sh`.
+def load_faces(path):
+    positions, uvs, faces = [], [], []
+    for line in open(path):
+        tokens = line.split()
+        if not tokens:
+            continue
+        if tokens[0] == "v":
+            positions.append(tuple(float(x) for x in tokens[1:4]))
+        elif tokens[0] == "vt":
+            uvs.append(tuple(float(x) for x in tokens[1:3]))
+        elif tokens[0] == "f":
+            corners = []
+            for token in tokens[1:4]:
+                v, vt = token.split("/")[:2]
+                corners.append((positions[int(v) - 1], uvs[int(vt) - 1]))
+            # The simplifier may rotate the corners of a face
+            faces.append(min(corners[i:] + corners[:i] for i in range(3)))
+    return faces
+
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    input_path = args[0] if args else "obj/Input/Seam.obj"
+    output_path = "/tmp/check_uv_roundtrip.obj"
+
+    subprocess.run(["./ms", input_path, output_path, "1.0"],
+                   stdout=subprocess.DEVNULL, check=True)
+
+    expected = load_faces(input_path)
+    actual = load_faces(output_path)
+    if expected != actual:
+        print("FAILED: uvs changed in", input_path)
+        for i, (e, a) in enumerate(zip(expected, actual)):
+            if e != a:
+                print("face", i + 1, "expected", e, "got", a)
+        sys.exit(1)
+    print("OK:", len(actual), "faces keep their uvs")